@@ -1,4 +1,9 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <vector>
 #include <vulkan/vulkan.h>
@@ -7,8 +12,19 @@
 // CONSTANTS
 // ----------------------------------------------------------------------------
 
-#define SHARED_BUFFER_SIZE 1024
-#define SOCKET_PATH        "/tmp/vulkan_socket"
+#define SHARED_FRAME_SIZE         1024
+#define SOCKET_PATH               "/tmp/vulkan_socket"
+#define HUGE_PAGE_SIZE            (2 * 1024 * 1024)
+
+// The message queue lives right after the frame region of the shared buffer
+#define MESSAGE_QUEUE_OFFSET      SHARED_FRAME_SIZE
+#define MESSAGE_QUEUE_HEADER_SIZE 128
+#define MESSAGE_QUEUE_CAPACITY    (64 * 1024)
+#define SHARED_BUFFER_SIZE        (MESSAGE_QUEUE_OFFSET + MESSAGE_QUEUE_HEADER_SIZE + MESSAGE_QUEUE_CAPACITY)
+
+// Tags sent along with the FD so the reader knows how to import it
+#define SHARE_MODE_OPAQUE_FD   'O'
+#define SHARE_MODE_HOST_MEMORY 'H'
 
 // ----------------------------------------------------------------------------
 // VARIABLES
@@ -38,11 +54,24 @@ VkDevice                 device;
 VkQueue                  queue;
 VkBuffer                 sharedBuffer;
 VkDeviceMemory           sharedMemory;
+VkDeviceSize             sharedMemorySize;
+VkDeviceSize             nonCoherentAtomSize;
 int                      socketFD;
 int                      connFD;
 int                      sharedBufferFD;
 std::string              sharedData;
 
+// Host memory mode: the shared FD is a memfd owned by the writer, mapped into
+// each process and imported into Vulkan via VK_EXT_external_memory_host.
+bool                     useHostMemory = false;
+void                    *hostMemory    = nullptr;
+VkDeviceSize             hostMemorySize;
+
+// Address range reserved so hostMemory can be placed at the alignment the
+// driver requires. Unmapping it also unmaps hostMemory.
+void                    *hostReservation = nullptr;
+VkDeviceSize             hostReservationSize;
+
 // ----------------------------------------------------------------------------
 // SHARED DECLARATIONS
 // ----------------------------------------------------------------------------
@@ -88,6 +117,402 @@ uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
     throw std::runtime_error("Failed to find suitable memory type!");
 }
 
+// ----------------------------------------------------------------------------
+// HOST MEMORY IMPORT
+// ----------------------------------------------------------------------------
+VkDeviceSize getHostPointerAlignment() {
+    VkPhysicalDeviceExternalMemoryHostPropertiesEXT hostProperties = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT,
+    };
+
+    VkPhysicalDeviceProperties2 properties = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+        .pNext = &hostProperties,
+    };
+
+    vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+
+    return hostProperties.minImportedHostPointerAlignment;
+}
+
+void importHostMemory() {
+    std::cout << "Importing host memory into Vulkan" << std::endl;
+
+    // Both the pointer and the allocation size must honor the driver's
+    // alignment requirement (see mapHostMemory()), otherwise the import is
+    // invalid.
+    VkDeviceSize alignment = getHostPointerAlignment();
+    std::cout << "Minimum imported host pointer alignment: " << alignment << std::endl;
+
+    if (reinterpret_cast<uintptr_t>(hostMemory) % alignment != 0 || hostMemorySize % alignment != 0) {
+        throw std::runtime_error("Host memory is not suitably aligned for import!");
+    }
+
+    VkExternalMemoryBufferCreateInfo externalBufferCreateInfo = {
+        .sType       = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO,
+        .handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+    };
+
+    VkBufferCreateInfo bufferCreateInfo = {
+        .sType       = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .pNext       = &externalBufferCreateInfo,
+        .size        = SHARED_BUFFER_SIZE,
+        .usage       = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+
+    if (vkCreateBuffer(device, &bufferCreateInfo, nullptr, &sharedBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create shared buffer!");
+    }
+
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(device, sharedBuffer, &memRequirements);
+    std::cout << "Memory requirements size: " << memRequirements.size << std::endl;
+    std::cout << "Memory type bits: " << memRequirements.memoryTypeBits << std::endl;
+
+    if (memRequirements.size > hostMemorySize) {
+        throw std::runtime_error("Host memory is too small for shared buffer!");
+    }
+
+    // Not every memory type can back an imported pointer, so narrow down the
+    // buffer's candidates to the ones the driver accepts for this pointer.
+    VkMemoryHostPointerPropertiesEXT hostPointerProperties = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT,
+    };
+
+    if (reinterpret_cast<PFN_vkGetMemoryHostPointerPropertiesEXT>(vkGetDeviceProcAddr(device, "vkGetMemoryHostPointerPropertiesEXT"))(device, VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT, hostMemory, &hostPointerProperties) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to get host pointer properties!");
+    }
+
+    std::cout << "Host pointer memory type bits: " << hostPointerProperties.memoryTypeBits << std::endl;
+
+    VkImportMemoryHostPointerInfoEXT importHostPointerInfo = {
+        .sType        = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT,
+        .handleType   = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+        .pHostPointer = hostMemory,
+    };
+
+    VkMemoryAllocateInfo allocInfo = {
+        .sType           = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .pNext           = &importHostPointerInfo,
+        .allocationSize  = hostMemorySize,
+        .memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits & hostPointerProperties.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT),
+    };
+
+    if (vkAllocateMemory(device, &allocInfo, nullptr, &sharedMemory) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to import host memory!");
+    }
+
+    sharedMemorySize = hostMemorySize;
+
+    if (vkBindBufferMemory(device, sharedBuffer, sharedMemory, 0) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to bind buffer memory!");
+    }
+}
+
+// Returns false when the FD can't be mapped, e.g. when it is hugepage backed
+// but no hugepages are reserved on the system.
+bool mapHostMemory() {
+    std::cout << "Mapping shared host memory FD" << std::endl;
+
+    struct stat fdStat;
+
+    if (fstat(sharedBufferFD, &fdStat) < 0) {
+        perror("fstat");
+        return false;
+    }
+
+    // mmap only guarantees page alignment, so reserve enough address space to
+    // place the FD at the driver's import alignment. Hugetlb FDs report their
+    // hugepage size as block size, which the mapping must be aligned to too.
+    VkDeviceSize alignment = std::max<VkDeviceSize>(getHostPointerAlignment(), fdStat.st_blksize);
+
+    hostMemorySize      = fdStat.st_size;
+    hostReservationSize = hostMemorySize + alignment;
+    hostReservation     = mmap(nullptr, hostReservationSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (hostReservation == MAP_FAILED) {
+        perror("mmap");
+        hostReservation = nullptr;
+        return false;
+    }
+
+    uintptr_t alignedAddress = (reinterpret_cast<uintptr_t>(hostReservation) + alignment - 1) / alignment * alignment;
+    hostMemory               = mmap(reinterpret_cast<void *>(alignedAddress), hostMemorySize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, sharedBufferFD, 0);
+
+    if (hostMemory == MAP_FAILED) {
+        perror("mmap");
+        munmap(hostReservation, hostReservationSize);
+        hostMemory      = nullptr;
+        hostReservation = nullptr;
+        return false;
+    }
+
+    std::cout << "Mapped " << hostMemorySize << " bytes of host memory" << std::endl;
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// MAPPED RANGE SYNCHRONIZATION
+// ----------------------------------------------------------------------------
+// Flushes (or invalidates) only the non-coherent atoms covering the given
+// range of the shared memory, instead of the whole allocation.
+void syncMappedRange(VkDeviceSize offset, VkDeviceSize size, bool invalidate) {
+    // In host memory mode the queue is only accessed through our own
+    // (coherent) mapping of the memfd, see mapMessageQueue(), so there is no
+    // Vulkan mapping to flush or invalidate.
+    if (useHostMemory) {
+        return;
+    }
+
+    VkDeviceSize begin = offset / nonCoherentAtomSize * nonCoherentAtomSize;
+    VkDeviceSize end   = (offset + size + nonCoherentAtomSize - 1) / nonCoherentAtomSize * nonCoherentAtomSize;
+
+    VkMappedMemoryRange memoryRange = {
+        .sType  = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+        .memory = sharedMemory,
+        .offset = begin,
+        .size   = end < sharedMemorySize ? end - begin : VK_WHOLE_SIZE,
+    };
+
+    if (invalidate) {
+        vkInvalidateMappedMemoryRanges(device, 1, &memoryRange);
+    } else {
+        vkFlushMappedMemoryRanges(device, 1, &memoryRange);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// MESSAGE QUEUE
+// ----------------------------------------------------------------------------
+// Lock-free multi-producer single-consumer ring of length-prefixed records
+// living in the shared buffer. Positions only ever grow, and are reduced
+// modulo the (power of two) capacity when indexing the ring.
+//
+// Each record starts with a 32 bit header holding its payload length. A
+// producer reserves space by bumping `head`, copies its payload and then
+// publishes the record by storing the header. The consumer walks committed
+// records from `tail`, zeroes them and hands the space back by moving `tail`.
+// A record that doesn't fit before the end of the ring is preceded by a
+// padding record covering the rest of it.
+//
+// Atomics operate directly on the mapped memory, so this relies on the shared
+// memory type being host coherent (which is what we allocate).
+#define MESSAGE_COMMITTED_BIT 0x80000000u
+#define MESSAGE_PADDING_BIT   0x40000000u
+#define MESSAGE_LENGTH_MASK   0x3fffffffu
+#define MESSAGE_ALIGNMENT     8
+
+struct MessageQueueHeader {
+    alignas(64) std::atomic<uint64_t> head;
+    alignas(64) std::atomic<uint64_t> tail;
+};
+
+static_assert(sizeof(MessageQueueHeader) == MESSAGE_QUEUE_HEADER_SIZE, "Message queue header size mismatch!");
+static_assert((MESSAGE_QUEUE_CAPACITY & (MESSAGE_QUEUE_CAPACITY - 1)) == 0, "Message queue capacity must be a power of two!");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Shared atomics must be lock free!");
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "Shared atomics must be lock free!");
+
+// Range of ring positions a producer touched since its last commit
+struct MessageBatch {
+    uint64_t begin = UINT64_MAX;
+    uint64_t end   = 0;
+};
+
+MessageQueueHeader *getMessageQueueHeader(void *mapping) {
+    return reinterpret_cast<MessageQueueHeader *>(static_cast<char *>(mapping) + MESSAGE_QUEUE_OFFSET);
+}
+
+char *getMessageQueueRing(void *mapping) {
+    return static_cast<char *>(mapping) + MESSAGE_QUEUE_OFFSET + MESSAGE_QUEUE_HEADER_SIZE;
+}
+
+std::atomic<uint32_t> *getRecordHeader(char *ring, uint64_t position) {
+    return reinterpret_cast<std::atomic<uint32_t> *>(ring + (position & (MESSAGE_QUEUE_CAPACITY - 1)));
+}
+
+uint64_t getRecordSize(uint32_t length) {
+    return (sizeof(uint32_t) + length + MESSAGE_ALIGNMENT - 1) & ~uint64_t(MESSAGE_ALIGNMENT - 1);
+}
+
+// Splits a range of ring positions into at most two contiguous segments
+// (offsets relative to the start of the ring).
+template <typename F>
+void forEachRingSegment(uint64_t begin, uint64_t end, F &&callback) {
+    if (end - begin >= MESSAGE_QUEUE_CAPACITY) {
+        callback(0, MESSAGE_QUEUE_CAPACITY);
+        return;
+    }
+
+    uint64_t offset     = begin & (MESSAGE_QUEUE_CAPACITY - 1);
+    uint64_t size       = end - begin;
+    uint64_t contiguous = std::min(size, MESSAGE_QUEUE_CAPACITY - offset);
+
+    if (contiguous > 0) {
+        callback(offset, contiguous);
+    }
+
+    if (size > contiguous) {
+        callback(0, size - contiguous);
+    }
+}
+
+void syncRingRange(uint64_t begin, uint64_t end, bool invalidate) {
+    forEachRingSegment(begin, end, [invalidate](uint64_t offset, uint64_t size) {
+        syncMappedRange(MESSAGE_QUEUE_OFFSET + MESSAGE_QUEUE_HEADER_SIZE + offset, size, invalidate);
+    });
+}
+
+void syncQueueHeader(bool invalidate) {
+    syncMappedRange(MESSAGE_QUEUE_OFFSET, MESSAGE_QUEUE_HEADER_SIZE, invalidate);
+}
+
+// In host memory mode our own mapping is the shared buffer, so both sides use
+// the queue through it directly. Otherwise the allocation is mapped with
+// Vulkan.
+void *mapMessageQueue() {
+    if (useHostMemory) {
+        return hostMemory;
+    }
+
+    void *data;
+
+    if (vkMapMemory(device, sharedMemory, 0, VK_WHOLE_SIZE, 0, &data) != VK_SUCCESS) {
+        throw std::runtime_error("Unable to map memory!");
+    }
+
+    return data;
+}
+
+void unmapMessageQueue() {
+    if (!useHostMemory) {
+        vkUnmapMemory(device, sharedMemory);
+    }
+}
+
+// Must run once, before any producer or consumer touches the queue
+void initMessageQueue(void *mapping) {
+    std::cout << "Initializing message queue" << std::endl;
+
+    memset(static_cast<char *>(mapping) + MESSAGE_QUEUE_OFFSET, 0, MESSAGE_QUEUE_HEADER_SIZE + MESSAGE_QUEUE_CAPACITY);
+    syncMappedRange(MESSAGE_QUEUE_OFFSET, MESSAGE_QUEUE_HEADER_SIZE + MESSAGE_QUEUE_CAPACITY, false);
+}
+
+// Returns false when the queue is full. Pushed records become visible to the
+// consumer right away, but are only flushed by commitMessages().
+bool pushMessage(void *mapping, MessageBatch &batch, const void *payload, uint32_t length) {
+    uint64_t recordSize = getRecordSize(length);
+
+    // A record needing wrap padding takes up to twice its size, so anything
+    // above half the ring could never fit at some head offsets.
+    if (length > MESSAGE_LENGTH_MASK || recordSize > MESSAGE_QUEUE_CAPACITY / 2) {
+        throw std::runtime_error("Message too large for queue!");
+    }
+
+    MessageQueueHeader *header = getMessageQueueHeader(mapping);
+    char               *ring   = getMessageQueueRing(mapping);
+    uint64_t            head   = header->head.load(std::memory_order_relaxed);
+    uint64_t            padding;
+
+    for (;;) {
+        uint64_t contiguous = MESSAGE_QUEUE_CAPACITY - (head & (MESSAGE_QUEUE_CAPACITY - 1));
+        padding             = contiguous < recordSize ? contiguous : 0;
+
+        if (head + padding + recordSize - header->tail.load(std::memory_order_acquire) > MESSAGE_QUEUE_CAPACITY) {
+            // Our head may be stale (the consumer could even be past it), so
+            // only report full if it still matches after reading tail.
+            uint64_t currentHead = header->head.load(std::memory_order_relaxed);
+
+            if (currentHead == head) {
+                return false;
+            }
+
+            head = currentHead;
+            continue;
+        }
+
+        if (header->head.compare_exchange_weak(head, head + padding + recordSize, std::memory_order_relaxed)) {
+            break;
+        }
+    }
+
+    if (padding > 0) {
+        getRecordHeader(ring, head)->store(MESSAGE_COMMITTED_BIT | MESSAGE_PADDING_BIT | uint32_t(padding - sizeof(uint32_t)), std::memory_order_release);
+    }
+
+    uint64_t position = head + padding;
+    memcpy(ring + (position & (MESSAGE_QUEUE_CAPACITY - 1)) + sizeof(uint32_t), payload, length);
+    getRecordHeader(ring, position)->store(MESSAGE_COMMITTED_BIT | length, std::memory_order_release);
+
+    batch.begin = std::min(batch.begin, head);
+    batch.end   = std::max(batch.end, position + recordSize);
+
+    return true;
+}
+
+// Flushes the atoms touched by a batch of pushes
+void commitMessages(MessageBatch &batch) {
+    if (batch.begin >= batch.end) {
+        return;
+    }
+
+    syncRingRange(batch.begin, batch.end, false);
+    syncQueueHeader(false);
+    batch = MessageBatch();
+}
+
+// Hands every committed record to the callback in order and frees their space
+// with a single tail update. Returns the amount of records consumed. The
+// callback is a template parameter so the per-record call can be inlined.
+template <typename F>
+size_t drainMessages(void *mapping, F &&callback) {
+    MessageQueueHeader *header = getMessageQueueHeader(mapping);
+    char               *ring   = getMessageQueueRing(mapping);
+
+    syncQueueHeader(true);
+
+    uint64_t tail     = header->tail.load(std::memory_order_relaxed);
+    uint64_t head     = header->head.load(std::memory_order_acquire);
+    uint64_t position = tail;
+    size_t   count    = 0;
+
+    syncRingRange(tail, head, true);
+
+    while (position != head) {
+        uint32_t recordHeader = getRecordHeader(ring, position)->load(std::memory_order_acquire);
+
+        // Reserved, but its producer hasn't published it yet
+        if (!(recordHeader & MESSAGE_COMMITTED_BIT)) {
+            break;
+        }
+
+        uint32_t length = recordHeader & MESSAGE_LENGTH_MASK;
+
+        if (!(recordHeader & MESSAGE_PADDING_BIT)) {
+            callback(ring + (position & (MESSAGE_QUEUE_CAPACITY - 1)) + sizeof(uint32_t), length);
+            count++;
+        }
+
+        position += getRecordSize(length);
+    }
+
+    if (position == tail) {
+        return 0;
+    }
+
+    // Producers rely on free space being zeroed, so stale payload bytes can't
+    // be mistaken for committed record headers later on.
+    forEachRingSegment(tail, position, [ring](uint64_t offset, uint64_t size) {
+        memset(ring + offset, 0, size);
+    });
+
+    syncRingRange(tail, position, false);
+    header->tail.store(position, std::memory_order_release);
+    syncQueueHeader(false);
+
+    return count;
+}
+
 // ----------------------------------------------------------------------------
 // VULKAN INITIALIZATION
 // ----------------------------------------------------------------------------
@@ -135,6 +560,43 @@ void setupDebugMessenger() {
     }
 }
 
+bool supportsDeviceExtension(VkPhysicalDevice device, const char *extensionName) {
+    uint32_t extensionCount;
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+    std::vector<VkExtensionProperties> extensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, extensions.data());
+
+    for (const auto &extension : extensions) {
+        if (strcmp(extension.extensionName, extensionName) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Host memory mode needs the extension, and host allocations must be
+// importable for buffers with the usage our shared buffer has.
+bool supportsHostMemoryImport(VkPhysicalDevice device) {
+    if (!supportsDeviceExtension(device, VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME)) {
+        return false;
+    }
+
+    VkPhysicalDeviceExternalBufferInfo externalBufferInfo = {
+        .sType      = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_BUFFER_INFO,
+        .usage      = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        .handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+    };
+
+    VkExternalBufferProperties externalBufferProperties = {
+        .sType = VK_STRUCTURE_TYPE_EXTERNAL_BUFFER_PROPERTIES,
+    };
+
+    vkGetPhysicalDeviceExternalBufferProperties(device, &externalBufferInfo, &externalBufferProperties);
+
+    return externalBufferProperties.externalMemoryProperties.externalMemoryFeatures & VK_EXTERNAL_MEMORY_FEATURE_IMPORTABLE_BIT;
+}
+
 void pickPhysicalDevice() {
     std::cout << "Selecting a physical device" << std::endl;
 
@@ -145,21 +607,38 @@ void pickPhysicalDevice() {
 
     physicalDevice = VK_NULL_HANDLE;
 
+    VkPhysicalDeviceProperties selectedProperties;
+
     for (const auto &device : devices) {
         VkPhysicalDeviceProperties deviceProperties;
         vkGetPhysicalDeviceProperties(device, &deviceProperties);
 
+        if (useHostMemory && !supportsHostMemoryImport(device)) {
+            std::cout << "Skipping device without host memory import: " << deviceProperties.deviceName << std::endl;
+            continue;
+        }
+
         // Enforce selection of NVidia card.
         if (deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) {
-            std::cout << "Selected device: " << deviceProperties.deviceName << std::endl;
-            physicalDevice = device;
+            physicalDevice     = device;
+            selectedProperties = deviceProperties;
             break;
         }
+
+        // Host memory mode doesn't need VRAM, so any device able to import
+        // host pointers will do (e.g. lavapipe) when there's no discrete GPU.
+        if (useHostMemory && physicalDevice == VK_NULL_HANDLE) {
+            physicalDevice     = device;
+            selectedProperties = deviceProperties;
+        }
     }
 
     if (physicalDevice == VK_NULL_HANDLE) {
         throw std::runtime_error("Failed to find a suitable GPU!");
     }
+
+    std::cout << "Selected device: " << selectedProperties.deviceName << std::endl;
+    nonCoherentAtomSize = selectedProperties.limits.nonCoherentAtomSize;
 }
 
 void createLogicalDeviceAndQueue() {
@@ -202,6 +681,11 @@ void initVulkan() {
     createInstance();
     setupDebugMessenger();
     pickPhysicalDevice();
+
+    if (useHostMemory) {
+        deviceExtensions.push_back(VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME);
+    }
+
     createLogicalDeviceAndQueue();
     createSharedMemoryObjectsAndFDs();
 }
@@ -217,4 +701,10 @@ void cleanup() {
     vkDestroyDevice(device, nullptr);
     ((PFN_vkDestroyDebugUtilsMessengerEXT)vkGetInstanceProcAddr(instance, "vkDestroyDebugUtilsMessengerEXT"))(instance, debugMessenger, nullptr);
     vkDestroyInstance(instance, nullptr);
+
+    // Imported host memory must outlive the Vulkan allocation importing it.
+    // hostMemory lives inside the reservation, so this unmaps both.
+    if (hostReservation) {
+        munmap(hostReservation, hostReservationSize);
+    }
 }
@@ -42,6 +42,9 @@ int receiveFD(int sock) {
 
     recvmsg(sock, &msg, 0);
 
+    // The writer tags the message with the kind of FD it is sending
+    useHostMemory = data[0] == SHARE_MODE_HOST_MEMORY;
+
     cmsg = CMSG_FIRSTHDR(&msg);
 
     return *((int *)CMSG_DATA(cmsg));
@@ -67,6 +70,7 @@ void loadFD() {
     sharedBufferFD = receiveFD(sock);
 
     std::cout << "Shared buffer FD: " << sharedBufferFD << std::endl;
+    std::cout << "Host memory mode: " << useHostMemory << std::endl;
     std::cout << "My PID: " << getpid() << std::endl;
 }
 
@@ -76,6 +80,17 @@ void loadFD() {
 void createSharedMemoryObjectsAndFDs() {
     std::cout << "Shared buffer FD: " << sharedBufferFD << std::endl;
 
+    // A memfd can't be imported as an opaque FD, so map it and import the
+    // resulting pointer instead.
+    if (useHostMemory) {
+        if (!mapHostMemory()) {
+            throw std::runtime_error("Failed to map shared memory FD!");
+        }
+
+        importHostMemory();
+        return;
+    }
+
     VkExternalMemoryBufferCreateInfo externalBufferCreateInfo = {
         .sType       = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO,
         .handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT,
@@ -134,6 +149,8 @@ void createSharedMemoryObjectsAndFDs() {
         throw std::runtime_error("Failed to allocate memory with external import!");
     }
 
+    sharedMemorySize = memRequirements.size;
+
     if (vkBindBufferMemory(device, sharedBuffer, sharedMemory, 0) != VK_SUCCESS) {
         throw std::runtime_error("Failed to bind buffer memory!");
     }
@@ -148,20 +165,24 @@ void readFromSharedMemory() {
     std::ios oldState(nullptr);
     oldState.copyfmt(std::cout);
 
-    void *data;
+    // In host memory mode the writer's buffer is mapped here too, so read it
+    // directly. Otherwise go through a Vulkan mapping.
+    void *data = hostMemory;
 
-    if (vkMapMemory(device, sharedMemory, 0, VK_WHOLE_SIZE, 0, &data) != VK_SUCCESS) {
-        throw std::runtime_error("Unable to map memory!");
-    }
+    if (!useHostMemory) {
+        if (vkMapMemory(device, sharedMemory, 0, VK_WHOLE_SIZE, 0, &data) != VK_SUCCESS) {
+            throw std::runtime_error("Unable to map memory!");
+        }
 
-    VkMappedMemoryRange memoryRange = {
-        .sType  = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
-        .memory = sharedMemory,
-        .offset = 0,
-        .size   = VK_WHOLE_SIZE,
-    };
+        VkMappedMemoryRange memoryRange = {
+            .sType  = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+            .memory = sharedMemory,
+            .offset = 0,
+            .size   = VK_WHOLE_SIZE,
+        };
 
-    vkInvalidateMappedMemoryRanges(device, 1, &memoryRange);
+        vkInvalidateMappedMemoryRanges(device, 1, &memoryRange);
+    }
 
     //for (size_t i = 0; i < SHARED_BUFFER_SIZE; i++) {
     //    char c = static_cast<char *>(data)[i];
@@ -172,7 +193,7 @@ void readFromSharedMemory() {
     //    //    break;
     //    //}
     //}
-    for (size_t i = 0; i < SHARED_BUFFER_SIZE; i++) {
+    for (size_t i = 0; i < SHARED_FRAME_SIZE; i++) {
         char c = ((char *)(data))[i];
 
         std::cout << (int)(c) << " ";
@@ -185,7 +206,26 @@ void readFromSharedMemory() {
     std::cout.copyfmt(oldState);
     std::cout << std::endl;
 
-    vkUnmapMemory(device, sharedMemory);
+    if (!useHostMemory) {
+        vkUnmapMemory(device, sharedMemory);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// DRAIN SMALL MESSAGES FROM THE SHARED QUEUE
+// ----------------------------------------------------------------------------
+void readMessages() {
+    std::cout << "Draining messages from shared queue:" << std::endl;
+
+    void *data = mapMessageQueue();
+
+    size_t count = drainMessages(data, [](const char *payload, uint32_t length) {
+        std::cout << std::string(payload, length) << std::endl;
+    });
+
+    std::cout << "Received " << count << " messages" << std::endl;
+
+    unmapMessageQueue();
 }
 
 // ----------------------------------------------------------------------------
@@ -204,6 +244,7 @@ int main() {
     std::getchar();
 
     readFromSharedMemory();
+    readMessages();
 
     close(socketFD);
     cleanup();
@@ -1,6 +1,18 @@
+#include <algorithm>
+#include <cstring>
 #include <filesystem>
+#include <linux/memfd.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <thread>
+
+// ----------------------------------------------------------------------------
+// CONSTANTS
+// ----------------------------------------------------------------------------
+#define MESSAGE_PRODUCER_COUNT 4
+#define MESSAGES_PER_PRODUCER  256
+#define MESSAGE_BATCH_SIZE     32
 
 // ----------------------------------------------------------------------------
 // VARIABLES
@@ -15,7 +27,61 @@ const char *appName = "VRAM sharing test (writer)";
 // ----------------------------------------------------------------------------
 // SPECIFIC WRITER INITIALIZATION
 // ----------------------------------------------------------------------------
+// Creates, sizes and maps a memfd with the given flags. Returns false (leaving
+// no FD behind) if any step fails.
+bool createHostMemoryFD(unsigned int flags, VkDeviceSize pageSize) {
+    sharedBufferFD = memfd_create("vulkan_shared_memory", flags);
+
+    if (sharedBufferFD < 0) {
+        perror("memfd_create");
+        return false;
+    }
+
+    // The size must be a multiple of both the page size and the alignment
+    // the driver wants for imported pointers.
+    VkDeviceSize alignment = std::max(pageSize, getHostPointerAlignment());
+    VkDeviceSize size      = (SHARED_BUFFER_SIZE + alignment - 1) / alignment * alignment;
+
+    if (ftruncate(sharedBufferFD, size) < 0) {
+        perror("ftruncate");
+        close(sharedBufferFD);
+        return false;
+    }
+
+    // Hugetlb memfds can be created and sized even with no hugepages
+    // reserved, in which case only the mapping fails.
+    if (!mapHostMemory()) {
+        close(sharedBufferFD);
+        return false;
+    }
+
+    return true;
+}
+
+void createHostMemoryObjectsAndFD() {
+    std::cout << "Creating shared host memory objects" << std::endl;
+
+    // Back the shared buffer with hugepages when possible, otherwise fall
+    // back to regular pages.
+    if (!createHostMemoryFD(MFD_CLOEXEC | MFD_HUGETLB | MFD_HUGE_2MB, HUGE_PAGE_SIZE)) {
+        std::cout << "Hugepages unavailable, falling back to regular pages" << std::endl;
+
+        if (!createHostMemoryFD(MFD_CLOEXEC, sysconf(_SC_PAGESIZE))) {
+            throw std::runtime_error("Failed to create shared memory FD!");
+        }
+    }
+
+    importHostMemory();
+
+    std::cout << "Shared buffer FD: " << sharedBufferFD << std::endl;
+}
+
 void createSharedMemoryObjectsAndFDs() {
+    if (useHostMemory) {
+        createHostMemoryObjectsAndFD();
+        return;
+    }
+
     std::cout << "Creating shared memory objects" << std::endl;
 
     VkExternalMemoryBufferCreateInfo externalBufferCreateInfo = {
@@ -50,6 +116,8 @@ void createSharedMemoryObjectsAndFDs() {
         throw std::runtime_error("Failed to allocate shared memory!");
     }
 
+    sharedMemorySize = memRequirements.size;
+
     if (vkBindBufferMemory(device, sharedBuffer, sharedMemory, 0) != VK_SUCCESS) {
         throw std::runtime_error("Failed to bind buffer memory!");
     }
@@ -73,6 +141,18 @@ void createSharedMemoryObjectsAndFDs() {
 // SEND DATA THROUGH THE GPU
 // ----------------------------------------------------------------------------
 void writeToSharedMemory() {
+    // In host memory mode our own mapping is the shared buffer, so producers
+    // write straight into it without going through vkMapMemory.
+    if (useHostMemory) {
+        std::cout << "Writing data into shared host memory" << std::endl;
+
+        for (size_t i = 0; i < 5; i++) {
+            ((char *)(hostMemory))[i] = 0x1;
+        }
+
+        return;
+    }
+
     std::cout << "Moving string data to GPU:" << std::endl;
     std::ios oldState(nullptr);
     oldState.copyfmt(std::cout);
@@ -106,6 +186,51 @@ void writeToSharedMemory() {
     vkFlushMappedMemoryRanges(device, 1, &memoryRange);
 }
 
+// ----------------------------------------------------------------------------
+// SEND SMALL MESSAGES THROUGH THE SHARED QUEUE
+// ----------------------------------------------------------------------------
+void createMessageQueue() {
+    initMessageQueue(mapMessageQueue());
+    unmapMessageQueue();
+}
+
+void pushMessages() {
+    std::cout << "Pushing messages from " << MESSAGE_PRODUCER_COUNT << " producers" << std::endl;
+
+    void *data = mapMessageQueue();
+
+    std::vector<std::thread> producers;
+
+    for (int p = 0; p < MESSAGE_PRODUCER_COUNT; p++) {
+        producers.emplace_back([data, p]() {
+            MessageBatch batch;
+            char         payload[64];
+
+            for (int i = 0; i < MESSAGES_PER_PRODUCER; i++) {
+                int length = snprintf(payload, sizeof(payload), "producer %d message %d", p, i);
+
+                // Queue is full: publish what we have and wait for the reader
+                while (!pushMessage(data, batch, payload, length)) {
+                    commitMessages(batch);
+                    std::this_thread::yield();
+                }
+
+                if ((i + 1) % MESSAGE_BATCH_SIZE == 0) {
+                    commitMessages(batch);
+                }
+            }
+
+            commitMessages(batch);
+        });
+    }
+
+    for (auto &producer : producers) {
+        producer.join();
+    }
+
+    unmapMessageQueue();
+}
+
 // ----------------------------------------------------------------------------
 // EXPORT FILE DESCRIPTOR SO CLIENT CAN READ IT
 // ----------------------------------------------------------------------------
@@ -121,7 +246,7 @@ void shareFD(int sock){
     memset(&msg, 0, sizeof(msghdr));
     memset(ctrl_buf, 0, CMSG_SPACE(sizeof(int)));
 
-    data[0]         = ' ';
+    data[0]         = useHostMemory ? SHARE_MODE_HOST_MEMORY : SHARE_MODE_OPAQUE_FD;
     iov[0].iov_base = data;
     iov[0].iov_len  = sizeof(data);
 
@@ -192,14 +317,14 @@ void readBackMemory() {
     std::ios oldState(nullptr);
     oldState.copyfmt(std::cout);
 
-    void *data;
+    // In host memory mode our own mapping is the shared buffer
+    void *data = hostMemory;
 
-    if (vkMapMemory(device, sharedMemory, 0, VK_WHOLE_SIZE, 0, &data) != VK_SUCCESS) {
+    if (!useHostMemory && vkMapMemory(device, sharedMemory, 0, VK_WHOLE_SIZE, 0, &data) != VK_SUCCESS) {
         throw std::runtime_error("Unable to map memory!");
     }
 
-
-    for (size_t i = 0; i < SHARED_BUFFER_SIZE; i++) {
+    for (size_t i = 0; i < SHARED_FRAME_SIZE; i++) {
         char c = static_cast<char *>(data)[i];
 
         std::cout << (int)(c) << " ";
@@ -208,19 +333,30 @@ void readBackMemory() {
     std::cout.copyfmt(oldState);
     std::cout << std::endl;
 
-    vkUnmapMemory(device, sharedMemory);
+    if (!useHostMemory) {
+        vkUnmapMemory(device, sharedMemory);
+    }
 }
 
 // ----------------------------------------------------------------------------
 // ENTRY POINT
 // ----------------------------------------------------------------------------
-int main() {
+int main(int argc, char **argv) {
     std::cout << "Launching Vulkan writer test app" << std::endl;
 
+    // Pass --host-memory to share a writer-owned memfd instead of exporting
+    // Vulkan-allocated memory.
+    useHostMemory = argc > 1 && strcmp(argv[1], "--host-memory") == 0;
+
+    if (useHostMemory) {
+        std::cout << "Using host memory mode" << std::endl;
+    }
+
     // Remove lingering socket file.
     std::filesystem::remove(SOCKET_PATH);
 
     initVulkan();
+    createMessageQueue();
 
     std::cout << std::endl;
     std::cout << "Sending FD through socket. You can run reader app now..." << std::endl;
@@ -234,6 +370,7 @@ int main() {
     std::getchar();
 
     writeToSharedMemory();
+    pushMessages();
 
     std::cout << "Reader app should have received data." << std::endl;
     std::cout << "Press ENTER to exit..." << std::endl;